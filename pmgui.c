@@ -22,7 +22,9 @@
  * Author.: Aaron Watry (awatry@gmail.com)
  * Purpose: Provide GUI reporting/control of the sysfs interfaces exported by
  *          the radeon kernel module
- * Usage..: ./radeon-pm-gui
+ * Usage..: ./radeon-pm-gui [--drm-dir DIR] [--benchmark SECONDS]
+ *          --drm-dir points at a fake/replayed copy of /sys/class/drm
+ *          --benchmark runs each profile for SECONDS, prints a report and exits
  * 
  * TODO...: - Report in disabled textbox if using dynpm or profile method
  *          - When profile, display current profile
@@ -37,6 +39,10 @@
  */
 
 #include <gtk/gtk.h>
+#include <math.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
 #include "pmlib.h"
 
 //echo "profile" > / sys / class / drm / card0 / device / power_method
@@ -55,6 +61,116 @@ static char* curCard = NULL;
 //     can swap the button statuses of all buttons
 static GObject** guiWidgets = NULL;
 
+//One energy counter per card, NULL terminated. Sampled once a second while
+//the GUI is up and reported when it exits.
+static pm_energy_t** energyCounters = NULL;
+#define ENERGY_SAMPLE_SECONDS 1
+#define BENCHMARK_SAMPLE_SECONDS 0.5
+
+#define USAGE "Usage: radeon-pm-gui [--drm-dir DIR] [--benchmark SECONDS]\n"
+
+static pm_energy_t** newEnergyCounters(){
+    char **cards = getCards((char*) DEFAULT_DRM_DIR);
+    pm_energy_t **counters;
+    pm_energy_t *counter;
+    int count = 0;
+    int used = 0;
+    int idx;
+    
+    if (cards == NULL)
+        return NULL;
+    
+    while (cards[count] != NULL)
+        count++;
+    
+    counters = calloc(count + 1, sizeof(pm_energy_t*));
+    if (counters != NULL){
+        for (idx = 0; idx < count; idx++){
+            //Skip a card we couldn't allocate for rather than terminating the list early
+            if ((counter = newEnergyCounter(cards[idx])) != NULL)
+                counters[used++] = counter;
+            else
+                g_printerr("Unable to track energy for %s\n", cards[idx]);
+        }
+    }
+    
+    freeCards(cards);
+    return counters;
+}
+
+static void freeEnergyCounters(pm_energy_t **counters){
+    int idx = 0;
+    
+    if (counters == NULL)
+        return;
+    
+    while (counters[idx] != NULL){
+        freeEnergyCounter(counters[idx++]);
+    }
+    free(counters);
+}
+
+static gboolean sampleEnergyCounters(gpointer data){
+    pm_energy_t **counters = (pm_energy_t**)data;
+    
+    while (counters != NULL && *counters != NULL){
+        sampleEnergy(*counters++);
+    }
+    
+    return TRUE;
+}
+
+static void printEnergyReports(pm_energy_t **counters){
+    while (counters != NULL && *counters != NULL){
+        printEnergyReport(*counters++, stdout);
+    }
+}
+
+static void interruptBenchmark(int signum){
+    benchmarkInterrupted = 1;
+}
+
+static int runBenchmark(double period){
+    pm_energy_t **counters;
+    struct sigaction action;
+    int idx = 0;
+    int retVal = 0;
+    
+    //Let Ctrl-C/SIGTERM stop the benchmark so the card gets its original
+    //profile back instead of being left wherever the benchmark was.
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = interruptBenchmark;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    
+    counters = newEnergyCounters();
+    if (counters == NULL || counters[0] == NULL){
+        g_printerr("Card list is empty.\n");
+        freeEnergyCounters(counters);
+        return 1;
+    }
+    
+    while (counters[idx] != NULL){
+        g_print("Benchmarking %s for %.1f seconds per profile\n", counters[idx]->card, period);
+        if (!benchmarkProfiles(counters[idx], period, BENCHMARK_SAMPLE_SECONDS)){
+            if (benchmarkInterrupted)
+                g_printerr("Benchmark of %s interrupted, original profile restored\n", counters[idx]->card);
+            else
+                g_printerr("Benchmark of %s incomplete: no power data or unable to set profile\n", counters[idx]->card);
+            retVal = 1;
+        }
+        printEnergyReport(counters[idx], stdout);
+        idx++;
+        
+        if (benchmarkInterrupted)
+            break;
+    }
+    
+    freeEnergyCounters(counters);
+    return retVal;
+}
+
 static void changeCard(GtkComboBoxText* combo,
         gpointer data){
     
@@ -186,6 +302,33 @@ int main(int argc,
     GtkToggleButton *toggle;
     char **cardNames;
 	int i;
+	double benchmarkPeriod = 0;
+	char *end;
+	
+	for (i = 1; i < argc; i++){
+		if (!strcmp(argv[i], "--drm-dir")){
+			if (i + 1 >= argc || *argv[i + 1] == '\0'){
+				g_printerr("--drm-dir requires a directory\n%s", USAGE);
+				return 1;
+			}
+			DEFAULT_DRM_DIR = argv[++i];
+		} else if (!strcmp(argv[i], "--benchmark")){
+			if (i + 1 >= argc){
+				g_printerr("--benchmark requires a number of seconds\n%s", USAGE);
+				return 1;
+			}
+			benchmarkPeriod = strtod(argv[++i], &end);
+			if (end == argv[i] || *end != '\0' || !isfinite(benchmarkPeriod) || benchmarkPeriod <= 0){
+				g_printerr("--benchmark: '%s' is not a positive number of seconds\n%s", argv[i], USAGE);
+				return 1;
+			}
+		}
+	}
+	
+	//Benchmark mode doesn't need (or want) a display
+	if (benchmarkPeriod > 0){
+		return runBenchmark(benchmarkPeriod);
+	}
 	
     gtk_init(&argc, &argv);
 
@@ -203,14 +346,13 @@ int main(int argc,
 	//Add all cards to combo box
 	cardNames = getCards((char*) DEFAULT_DRM_DIR);
 	if (cardNames != NULL){
-		while (*cardNames != NULL){
-			g_print("Adding card %s\n", *cardNames);
+		for (i = 0; cardNames[i] != NULL; i++){
+			g_print("Adding card %s\n", cardNames[i]);
 			//XXX: Add some identifying information to the card names (model/brand/etc).
 			//XXX: During detection, store a chipset manufacturer (AMD/Nv) somewhere.
 			//XXX: Either store a list of names, a list of descriptions, list of manufacturers, etc..
 			//     Or use a standardized delimiter to make parsing easy.
-			gtk_combo_box_text_append_text( GTK_COMBO_BOX_TEXT( cards ), *cardNames );
-			cardNames++;
+			gtk_combo_box_text_append_text( GTK_COMBO_BOX_TEXT( cards ), cardNames[i] );
 		}
 		freeCards(cardNames);
 	}
@@ -251,7 +393,14 @@ int main(int argc,
 	//XXX: Set the current index/text for the combo box to the first card in the list.
 	//XXX: use the changeCard callback
 	
+	energyCounters = newEnergyCounters();
+	sampleEnergyCounters(energyCounters);
+	g_timeout_add_seconds(ENERGY_SAMPLE_SECONDS, sampleEnergyCounters, energyCounters);
+	
     gtk_main();
 
+	printEnergyReports(energyCounters);
+	freeEnergyCounters(energyCounters);
+
     return 0;
 }
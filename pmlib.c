@@ -22,6 +22,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 //Checked DRM headers for something that looked useful, but didn't see anything
 //other than possibly using the raw ioctls, which I'm not ready to do.
@@ -45,7 +47,23 @@ const char* DEFAULT_PROFILE_PATH = "/device/power_profile";
 const char* DEFAULT_TEMP_PATH = "/device/hwmon/hwmon1/temp1_input";
 #define TEMP_UNKNOWN 0
 
+//hwmon nodes are searched for under every hwmonN directory of the card, since
+//the hwmon index is not stable across boots or between cards.
+const char* DEFAULT_HWMON_PATH = "/device/hwmon";
+const char* POWER_AVERAGE_NODE = "power1_average";
+const char* VOLTAGE_NODE = "in0_input";
+const char* CURRENT_NODE = "curr1_input";
+
+//Set (e.g. from a signal handler) to cut a benchmark short. The current
+//profile's sampling stops and the original settings are restored.
+volatile sig_atomic_t benchmarkInterrupted = 0;
+
 static char *buildPath(const char *baseDir, const char *card, const char *fileLocation);
+static char *findHwmonDir(const char *card, const char *node, const char *otherNode);
+static int readHwmonNode(const char *hwmonDir, const char *node, long *value);
+static int readLong(const char *fileName, long *value);
+static double monotonicSeconds();
+static int nodeExists(const char *card, const char *fileLocation);
 static char *readLine(const char *fileName, char *dest, int maxLength);
 static char *stripNewLine(char *input);
 static int writeFile(const char* fileName, const char* contents);
@@ -195,6 +213,257 @@ int getTemperature(char *card){
     return retVal;
 }
 
+/**
+ * Returns the current power draw of the card in microwatts, or POWER_UNKNOWN.
+ * power1_average is preferred; otherwise in0_input (mV) * curr1_input (mA),
+ * which also comes out in microwatts.
+ */
+long getPower(char *card){
+    long retVal = POWER_UNKNOWN;
+    long millivolts, milliamps;
+    char *hwmonDir;
+    
+    if (card == NULL){
+        return POWER_UNKNOWN;
+    }
+    
+    hwmonDir = findHwmonDir(card, POWER_AVERAGE_NODE, NULL);
+    if (hwmonDir != NULL){
+        if (!readHwmonNode(hwmonDir, POWER_AVERAGE_NODE, &retVal)){
+            retVal = POWER_UNKNOWN;
+        }
+        free(hwmonDir);
+        return retVal;
+    }
+    
+    //Voltage and current have to come from the same sensor to mean anything
+    hwmonDir = findHwmonDir(card, VOLTAGE_NODE, CURRENT_NODE);
+    if (hwmonDir == NULL){
+        return POWER_UNKNOWN;
+    }
+    
+    if (readHwmonNode(hwmonDir, VOLTAGE_NODE, &millivolts) &&
+            readHwmonNode(hwmonDir, CURRENT_NODE, &milliamps)){
+        retVal = millivolts * milliamps;
+    }
+    free(hwmonDir);
+    
+    return retVal;
+}
+
+pm_energy_t *newEnergyCounter(char *card){
+    pm_energy_t *counter;
+    
+    if (card == NULL){
+        return NULL;
+    }
+    
+    counter = calloc(1, sizeof(pm_energy_t));
+    if (counter == NULL){
+        return NULL;
+    }
+    
+    counter->card = malloc(strlen(card) + 1);
+    if (counter->card == NULL){
+        free(counter);
+        return NULL;
+    }
+    strcpy(counter->card, card);
+    counter->hasSample = PM_FALSE;
+    
+    //Checked once so that sampling a card without them doesn't log a failed
+    //read every time
+    counter->hasPMNodes = (nodeExists(card, DEFAULT_METHOD_PATH) &&
+            nodeExists(card, DEFAULT_PROFILE_PATH));
+    
+    return counter;
+}
+
+void freeEnergyCounter(pm_energy_t *counter){
+    if (counter == NULL)
+        return;
+    
+    free(counter->card);
+    free(counter);
+}
+
+/**
+ * Takes one power sample and integrates the energy used since the previous
+ * sample (trapezoidal rule). The interval is charged to the method/profile
+ * that was active at the previous sample, so call this often enough that a
+ * profile change is never more than one interval stale.
+ * 
+ * Returns PM_FALSE if the card exposes no usable power data; the next good
+ * sample then starts a fresh interval rather than bridging the gap.
+ */
+int sampleEnergy(pm_energy_t *counter){
+    double now;
+    long power;
+    pm_method_t method;
+    pm_profile_t profile;
+    
+    if (counter == NULL)
+        return PM_FALSE;
+    
+    now = monotonicSeconds();
+    power = getPower(counter->card);
+    if (power == POWER_UNKNOWN){
+        counter->hasSample = PM_FALSE;
+        return PM_FALSE;
+    }
+    
+    if (counter->hasPMNodes){
+        method = getMethod(counter->card);
+        profile = (method == PROFILE ? getProfile(counter->card) : PROFILE_UNKNOWN);
+    } else {
+        method = METHOD_UNKNOWN;
+        profile = PROFILE_UNKNOWN;
+    }
+    
+    if (counter->hasSample && now > counter->lastTime){
+        double seconds = now - counter->lastTime;
+        double watts = (counter->lastPower + power) / 2.0 / 1000000.0;
+        pm_energy_bucket_t *bucket = &counter->buckets[counter->lastMethod][counter->lastProfile];
+        
+        bucket->joules += watts * seconds;
+        bucket->seconds += seconds;
+    }
+    
+    counter->lastMethod = method;
+    counter->lastProfile = profile;
+    counter->lastPower = power;
+    counter->lastTime = now;
+    counter->hasSample = PM_TRUE;
+    
+    return PM_TRUE;
+}
+
+/**
+ * Writes joules, average watts and time for every method/profile the card
+ * has spent time in. The last column is each row's average power relative to
+ * the most frugal row, which is what a benchmark run is compared on.
+ */
+void printEnergyReport(pm_energy_t *counter, FILE *out){
+    double minWatts = -1;
+    int method, profile;
+    
+    if (counter == NULL || out == NULL)
+        return;
+    
+    for (method = 0; method <= MAX_METHOD; method++){
+        for (profile = 0; profile <= MAX_PROFILE; profile++){
+            pm_energy_bucket_t *bucket = &counter->buckets[method][profile];
+            if (bucket->seconds <= 0)
+                continue;
+            double watts = bucket->joules / bucket->seconds;
+            if (minWatts < 0 || watts < minWatts)
+                minWatts = watts;
+        }
+    }
+    
+    fprintf(out, "Energy report for %s\n", counter->card);
+    if (minWatts < 0){
+        fprintf(out, "  No power samples recorded\n");
+        return;
+    }
+    
+    fprintf(out, "  %-8s %-8s %10s %12s %10s %8s\n",
+            "method", "profile", "time (s)", "energy (J)", "avg (W)", "rel");
+    for (method = 0; method <= MAX_METHOD; method++){
+        for (profile = 0; profile <= MAX_PROFILE; profile++){
+            pm_energy_bucket_t *bucket = &counter->buckets[method][profile];
+            if (bucket->seconds <= 0)
+                continue;
+            double watts = bucket->joules / bucket->seconds;
+            char rel[16];
+            
+            //Nothing is a multiple of 0 W, so don't pretend otherwise
+            if (minWatts > 0)
+                snprintf(rel, sizeof(rel), "%.2f", watts / minWatts);
+            else
+                strcpy(rel, (watts > 0 ? "inf" : "-"));
+            
+            fprintf(out, "  %-8s %-8s %10.2f %12.2f %10.2f %8s\n",
+                    pm_method_names[method],
+                    (method == PROFILE ? pm_profile_names[profile] : "-"),
+                    bucket->seconds, bucket->joules, watts, rel);
+        }
+    }
+}
+
+/**
+ * Runs the card for a fixed period under each of low, medium, high and dynpm,
+ * sampling every interval seconds into counter. The original method/profile
+ * is restored afterwards, including when benchmarkInterrupted is raised part
+ * way through (which returns PM_FALSE). Nothing here generates GPU load, so run the
+ * workload to be compared alongside (or replay one through a fake sysfs).
+ */
+int benchmarkProfiles(pm_energy_t *counter, double period, double interval){
+    static const pm_method_t methods[] = { PROFILE, PROFILE, PROFILE, DYNPM };
+    static const pm_profile_t profiles[] = { LOW, MEDIUM, HIGH, PROFILE_UNKNOWN };
+    pm_method_t origMethod;
+    pm_profile_t origProfile;
+    int retVal = PM_TRUE;
+    size_t idx;
+    
+    if (counter == NULL || period <= 0 || interval <= 0)
+        return PM_FALSE;
+    
+    //No point cycling the profiles of a card we can't measure or switch
+    if (!counter->hasPMNodes || getPower(counter->card) == POWER_UNKNOWN)
+        return PM_FALSE;
+    
+    origMethod = getMethod(counter->card);
+    origProfile = (origMethod == PROFILE ? getProfile(counter->card) : PROFILE_UNKNOWN);
+    
+    for (idx = 0; idx < sizeof(methods) / sizeof(methods[0]); idx++){
+        struct timespec delay;
+        double start;
+        
+        if (benchmarkInterrupted){
+            retVal = PM_FALSE;
+            break;
+        }
+        
+        if (!setMethod(counter->card, methods[idx]) ||
+                (methods[idx] == PROFILE && !setProfile(counter->card, profiles[idx]))){
+            retVal = PM_FALSE;
+            break;
+        }
+        
+        //Don't charge the switch-over to the new profile
+        counter->hasSample = PM_FALSE;
+        start = monotonicSeconds();
+        if (!sampleEnergy(counter)){
+            retVal = PM_FALSE;
+            break;
+        }
+        
+        delay.tv_sec = (time_t)interval;
+        delay.tv_nsec = (long)((interval - delay.tv_sec) * 1000000000.0);
+        while (!benchmarkInterrupted && monotonicSeconds() - start < period){
+            nanosleep(&delay, NULL);
+            sampleEnergy(counter);
+        }
+        
+        if (benchmarkInterrupted){
+            retVal = PM_FALSE;
+            break;
+        }
+    }
+    
+    //Put the card back the way we found it
+    if (origMethod != METHOD_UNKNOWN){
+        setMethod(counter->card, origMethod);
+        if (origMethod == PROFILE && origProfile != PROFILE_UNKNOWN){
+            setProfile(counter->card, origProfile);
+        }
+    }
+    counter->hasSample = PM_FALSE;
+    
+    return retVal;
+}
+
 char** getCards(char *dirName){
     if (dirName == NULL){
         return NULL;
@@ -243,13 +512,15 @@ char** getCards(char *dirName){
 }
 
 void freeCards(char **cards){
+    int idx = 0;
+    
     if (cards == NULL)
         return;
     
-    while (*cards++ != NULL){
-        free(*cards);
+    while (cards[idx] != NULL){
+        free(cards[idx++]);
     }
-    
+    free(cards);
 }
 
 uint countCards(char **cards){
@@ -325,7 +596,7 @@ static int writeFile(const char *fileName, const char *contents){
 }
 
 static char *buildPath(const char *baseDir, const char *card, const char *fileLocation){
-    char *fileName = malloc(strlen(DEFAULT_DRM_DIR) + 1 + strlen(card) + strlen(DEFAULT_METHOD_PATH) + 1);
+    char *fileName = malloc(strlen(baseDir) + 1 + strlen(card) + strlen(fileLocation) + 1);
     if (fileName == NULL)
         return NULL;
     
@@ -337,6 +608,102 @@ static char *buildPath(const char *baseDir, const char *card, const char *fileLo
     return fileName;
 }
 
+/**
+ * Returns the first hwmonN directory of the card that has node (and otherNode,
+ * if not NULL) readable, or NULL.
+ */
+static char *findHwmonDir(const char *card, const char *node, const char *otherNode){
+    char *baseDir, *hwmonDir = NULL;
+    struct dirent *dirEntry;
+    DIR *dir;
+    
+    baseDir = buildPath(DEFAULT_DRM_DIR, card, DEFAULT_HWMON_PATH);
+    if (baseDir == NULL)
+        return NULL;
+    
+    dir = opendir(baseDir);
+    if (dir == NULL){
+        free(baseDir);
+        return NULL;
+    }
+    
+    while ((dirEntry = readdir(dir)) != NULL){
+        if (strncmp(dirEntry->d_name, "hwmon", 5))
+            continue;
+        
+        //baseDir/hwmonN
+        hwmonDir = malloc(strlen(baseDir) + 1 + strlen(dirEntry->d_name) + 1);
+        if (hwmonDir == NULL)
+            break;
+        sprintf(hwmonDir, "%s/%s", baseDir, dirEntry->d_name);
+        
+        if (readHwmonNode(hwmonDir, node, NULL) &&
+                (otherNode == NULL || readHwmonNode(hwmonDir, otherNode, NULL)))
+            break;
+        
+        free(hwmonDir);
+        hwmonDir = NULL;
+    }
+    
+    closedir(dir);
+    free(baseDir);
+    return hwmonDir;
+}
+
+/**
+ * Reads hwmonDir/node into value. With a NULL value, only checks that the
+ * node is readable.
+ */
+static int readHwmonNode(const char *hwmonDir, const char *node, long *value){
+    int retVal = PM_FALSE;
+    char *fileName = malloc(strlen(hwmonDir) + 1 + strlen(node) + 1);
+    
+    if (fileName == NULL)
+        return PM_FALSE;
+    sprintf(fileName, "%s/%s", hwmonDir, node);
+    
+    if (value == NULL)
+        retVal = (access(fileName, R_OK) == 0 ? PM_TRUE : PM_FALSE);
+    else
+        retVal = readLong(fileName, value);
+    
+    free(fileName);
+    return retVal;
+}
+
+static int nodeExists(const char *card, const char *fileLocation){
+    int retVal = PM_FALSE;
+    char *fileName = buildPath(DEFAULT_DRM_DIR, card, fileLocation);
+    
+    if (fileName == NULL)
+        return PM_FALSE;
+    
+    if (access(fileName, R_OK) == 0)
+        retVal = PM_TRUE;
+    
+    free(fileName);
+    return retVal;
+}
+
+static int readLong(const char *fileName, long *value){
+    int valueStrLen = 32;
+    char valueStr[32];
+    char *end;
+    
+    if (stripNewLine(readLine(fileName, valueStr, valueStrLen)) == NULL)
+        return PM_FALSE;
+    
+    *value = strtol(valueStr, &end, 10);
+    return (end != valueStr ? PM_TRUE : PM_FALSE);
+}
+
+static double monotonicSeconds(){
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
 int canModifyPM(){
     __uid_t uid = geteuid();
     
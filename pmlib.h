@@ -27,6 +27,9 @@
 #ifndef PMLIB_H
 #define	PMLIB_H
 
+#include <signal.h>
+#include <stdio.h>
+
 #ifdef	__cplusplus
 extern "C" {
 #endif
@@ -44,10 +47,33 @@ extern const char * const pm_method_names[];
 extern const char* DEFAULT_DRM_DIR;
 extern const char* DEFAULT_METHOD_PATH;
 extern const char* DEFAULT_PROFILE_PATH;
+extern const char* DEFAULT_HWMON_PATH;
+extern volatile sig_atomic_t benchmarkInterrupted;
 
 #define PM_TRUE 1
 #define PM_FALSE 0
 
+#define POWER_UNKNOWN -1
+
+//Energy accumulated while a card sat in a single method/profile combination
+typedef struct pm_energy_bucket_t {
+    double joules;
+    double seconds;
+} pm_energy_bucket_t;
+
+//Running energy counter for one card. Buckets are indexed by
+//[method][profile]; dynpm is always recorded under PROFILE_UNKNOWN.
+typedef struct pm_energy_t {
+    char *card;
+    pm_energy_bucket_t buckets[MAX_METHOD + 1][MAX_PROFILE + 1];
+    pm_method_t lastMethod;
+    pm_profile_t lastProfile;
+    long lastPower;
+    double lastTime;
+    int hasSample;
+    int hasPMNodes;     //power_method/power_profile exist (not on amdgpu)
+} pm_energy_t;
+
 pm_method_t getMethod(char *card);
 const char* getMethodName(pm_method_t method);
 pm_profile_t getProfile(char *card);
@@ -55,6 +81,12 @@ const char* getProfileName(pm_profile_t profile);
 int setMethod(char *card, pm_method_t newMethod);
 int setProfile(char *card, pm_profile_t newProfile);
 int getTemperature(char *card);
+long getPower(char *card);
+pm_energy_t *newEnergyCounter(char *card);
+void freeEnergyCounter(pm_energy_t *counter);
+int sampleEnergy(pm_energy_t *counter);
+void printEnergyReport(pm_energy_t *counter, FILE *out);
+int benchmarkProfiles(pm_energy_t *counter, double period, double interval);
 char *getFreqInfo(char *card);
 char** getCards(char*);
 void freeCards(char **cards);